@@ -13,93 +13,152 @@
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
-#include <semaphore.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "banker.h"
-#include "scenarios.h"
+#include "sim.h"
 
-pthread_mutex_t is_remain;
-pthread_cond_t s;
-
-struct p_resource {
-   int allocated;
+// A thread's claim on one resource. Each thread has a list of claims for just
+// the resources it called setmax() for, so the safety check never looks at the
+// resources a thread doesn't use. The claims come from a pool in banker_state
+// and are linked by index rather than by pointer, so the list still makes sense
+// when the tables are mapped at another address.
+struct claim {
+   int r;
    int max;
+   int allocated;
+   int asking; // amount being tested by the safety check, otherwise 0
+   int next;   // next claim in the thread's list or in the free list, or -1
 };
 
 struct thread_res {
    bool started;
-   p_resource res[R];
+   pid_t owner; // process using this slot, or 0 while it is free, set only by CAS
+   int claims;  // first of this thread's claims in the pool, or -1 if none
 };
 
-struct node {
-   int id;
-   struct node *next;
-   struct node *prev;
+// All of the banker's tables are kept together, so that banker_share() can
+// move them into shared memory, or banker_restore() into a file. bank points to
+// whichever copy is in use. Since a file may outlive the program that wrote it,
+// the layout carries a version, which must be bumped whenever it changes.
+#define BANKER_MAGIC 0xba4e0001
+#define BANKER_VERSION 3
+
+struct banker_state {
+   unsigned int magic;   // BANKER_MAGIC once the state is initialized
+   unsigned int version; // BANKER_VERSION
+   unsigned int size;    // sizeof(banker_state)
+   pthread_mutex_t is_remain;
+   pthread_cond_t s;
+   int remaining[R];
+   thread_res thread_list[N];
+   unsigned int holders[R]; // bit i is set if thread i has a claim on resource r
+   int free_claim;          // first unused claim in the pool, or -1 if none
+   claim pool[CLAIMS];
 };
 
-thread_res thread_list[N];
-int remaining[R];
-void setmax(int, int, int);
-void starting(int, int, int);
+banker_state local_bank;
+banker_state *bank = &local_bank;
+bool shared = false; // true if bank is in shared memory
+bool verbose = true;
+int setmax(int, int, int);
+int starting(int);
 void alloc(int, int, int);
-void release(int, int, int);
+int release(int, int, int);
+int holding(int, int);
+int try_alloc(alloc_req *, int);
 void finished(int);
 bool bankers();
-void release_temp(int, int*, node*&, node*&);
-
-int main(int argc, char **argv) {
-
-   if (pthread_mutex_init(&is_remain, NULL)) {
-      printf("Error: unable to initalize mutex\n");
-      return -1;
-   }
-     
-   if (pthread_cond_init(&s, NULL)) {
-      printf("Error unable to initalize the semaphore\n");
-      return -1;
-   }
-
-   for (int i = 0; i < R; i++) {
-      remaining[i] = TOTAL[i];
-   }
-    pthread_t id[N];
-    for (int i = 0; i < N; i++)
-        pthread_create(&id[i], NULL, &scenarioA, NULL);
-    
-    for (int i = 0; i < N; i++)
-        pthread_join(id[i], NULL);
-
-    printf("All threads have finished... no deadlock!\n");
-}
+bool fast_safe(int, const int *);
+claim *find_claim(int, int);
+int getslot();
+int takeslot();
+void putslot(int);
+int init_state(banker_state *, bool);
+int init_locks(banker_state *, bool);
+int check_layout(banker_state *, const char *);
+void repair();
+void lock_bank();
+void wait_bank();
+void recover();
+void reap();
+void clear_slot(int);
 
 /***********************************************************
- * void setmax(int, int, int)
+ * int setmax(int, int, int)
  * Pre: the calling thread is started and max, 
  * i and r are valid ints
- * Post: the max of that resource will be set 
+ * Post: the max of that resource will be set, taking a
+ * claim from the pool if thread i had none on r. Returns
+ * 0, or -1 on error
  *********************************************************/
 
-void setmax(int i, int r, int amt) {
-   if (thread_list[i].started) {
+int setmax(int i, int r, int amt) {
+   int err = 0;
+   if (bank->thread_list[i].started) {
       printf("Error: this thread has already set its max\n");
+      err = -1;
    } else if (amt > TOTAL[r]) {
       printf("Error: we don't physically have that amount of that resource\n");
+      err = -1;
    } else { 
-      thread_list[i].res[r].max = amt;
+      lock_bank();
+      claim *c = find_claim(i, r);
+      if (c != NULL) {
+	 c->max = amt;
+      } else if (amt > 0 && bank->free_claim < 0) {
+	 printf("Error: no room for more than %d claims\n", CLAIMS);
+	 err = -1;
+      } else if (amt > 0) {
+	 int k = bank->free_claim;
+	 bank->free_claim = bank->pool[k].next;
+	 bank->pool[k].r = r;
+	 bank->pool[k].max = amt;
+	 bank->pool[k].allocated = 0;
+	 bank->pool[k].asking = 0;
+	 bank->pool[k].next = bank->thread_list[i].claims;
+	 bank->thread_list[i].claims = k;
+	 bank->holders[r] |= 1u << i;
+      }
+      pthread_mutex_unlock(&bank->is_remain);
    }
+   return err;
 }
 
 /***********************************************************
- * void starting(int)
+ * claim *find_claim(int, int)
+ * Pre: i and r are valid ints
+ * Post: thread i's claim on resource r is returned, or 
+ * NULL if it has none
+ *********************************************************/
+claim *find_claim(int i, int r) {
+   for (int c = bank->thread_list[i].claims; c >= 0; c = bank->pool[c].next) {
+      if (bank->pool[c].r == r) {
+	 return &bank->pool[c];
+      }
+   }
+   return NULL;
+}
+
+/***********************************************************
+ * int starting(int)
  * Pre: i in a valid int, a max has been set
  * Post: the thread will be set as started
- * and all allocated values will be set to 0
+ * and all allocated values will be set to 0. Returns 0,
+ * or -1 on error
  *********************************************************/
-void starting(int i) {
-   if (thread_list[i].started) {
+int starting(int i) {
+   if (bank->thread_list[i].started) {
       printf("ERROR: the thread has already started\n");
-      return;
+      return -1;
    }
-   thread_list[i].started = true;
+   bank->thread_list[i].started = true;
+   return 0;
 }
 
 /***********************************************************
@@ -111,41 +170,54 @@ void starting(int i) {
  *********************************************************/
 void alloc(int i, int r, int amt) {
 
-   if (!thread_list[i].started) {
+   if (!bank->thread_list[i].started) {
       printf("Error: this thread has not started\n");
       return;
    }
 
-   if (thread_list[i].res[r].max < (amt + thread_list[i].res[r].allocated)) {
+   //nothing to allocate, so nothing to check, just as in release()
+   if (amt == 0) {
+      return;
+   }
+
+   claim *c = find_claim(i, r);
+   if (c == NULL || c->max < (amt + c->allocated)) {
       printf("Error: can't allocate more than the max\n");
       return;
    }
 
-   pthread_mutex_lock(&is_remain);
+   sim_yield();
+   lock_bank();
    bool done = false;
    while (!done) {
-      printf("Thread %d is trying to allocate %d of resource %d\n", i, amt, r); 
+      TRACE("Thread %d is trying to allocate %d of resource %d\n", i, amt, r); 
       //if amt isn't avail wait 
-      if (amt > remaining[r]) {
-	 printf("resource is not available waiting\n");
-	 pthread_cond_wait(&s, &is_remain);
-	 printf("done waiting\n");
+      if (amt > bank->remaining[r]) {
+	 TRACE("resource is not available waiting\n");
+	 wait_bank();
+	 TRACE("done waiting\n");
       } else {
-	 bool safe = false;
-	 remaining[r] -= amt;
-	 thread_list[i].res[r].allocated += amt;
-	 printf("testing if this allocation is safe\n");
-	 safe = bankers();
+	 //the allocation is only tested, not made, until it is known
+	 //to be safe, so the tables never hold an unsafe state
+	 int avail[R];
+	 for (int j = 0; j < R; j++) {
+	    avail[j] = bank->remaining[j];
+	 }
+	 avail[r] -= amt;
+	 c->asking = amt;
+	 TRACE("testing if this allocation is safe\n");
+	 bool safe = fast_safe(i, avail) || bankers();
+	 c->asking = 0;
 	 if (!safe) {
-	    printf("allocation is not safe, waiting\n");
-	    remaining[r]+= amt;
-	    thread_list[i].res[r].allocated -= amt;
-	    pthread_cond_wait(&s, &is_remain);
-	    printf("done waiting\n");
+	    TRACE("allocation is not safe, waiting\n");
+	    wait_bank();
+	    TRACE("done waiting\n");
 	 } else {
-	    pthread_mutex_unlock(&is_remain);
+	    c->allocated += amt;
+	    bank->remaining[r] -= amt;
+	    pthread_mutex_unlock(&bank->is_remain);
 	    done = true;
-	    printf("allocation is safe, complete\n\n");
+	    TRACE("allocation is safe, complete\n\n");
 	 }
       }
    }
@@ -153,155 +225,664 @@ void alloc(int i, int r, int amt) {
 }
 
 /***********************************************************
- * void release(int, int, int)
+ * int try_alloc(alloc_req *, int)
+ * Pre: reqs holds n requests
+ * Post: each request's result is set, to 0 if its amt was
+ * allocated, 1 if it is not safe yet or an earlier request
+ * for the same thread is waiting, or -1 on error. The
+ * number granted is returned
+ *********************************************************/
+int try_alloc(alloc_req *reqs, int n) {
+
+   int left[R];
+   lock_bank();
+   for (int j = 0; j < R; j++) {
+      left[j] = bank->remaining[j];
+   }
+   int granted = 0;
+   unsigned int waiting = 0; //threads with a request that must wait
+   //first ask for every allocation that fits
+   for (int k = 0; k < n; k++) {
+      int i = reqs[k].i;
+      claim *c = find_claim(i, reqs[k].r);
+      int amt = reqs[k].amt;
+      if (waiting & (1u << i)) {
+	 reqs[k].result = 1;
+      } else if (!bank->thread_list[i].started) {
+	 reqs[k].result = -1;
+      } else if (amt == 0) {
+	 reqs[k].result = 0;
+	 granted++;
+      } else if (c == NULL || c->max < (amt + c->asking + c->allocated)) {
+	 reqs[k].result = -1;
+      } else if (amt > left[reqs[k].r]) {
+	 reqs[k].result = 1;
+	 waiting |= 1u << i;
+      } else {
+	 c->asking += amt;
+	 left[reqs[k].r] -= amt;
+	 reqs[k].result = 0;
+	 granted++;
+      }
+   }
+
+   //one safety check covers the whole batch, if it passes
+   if (granted > 0 && !bankers()) {
+      TRACE("batch of %d is not safe, trying one at a time\n", granted);
+      for (int k = 0; k < n; k++) {
+	 if (reqs[k].result == 0 && reqs[k].amt > 0) {
+	    find_claim(reqs[k].i, reqs[k].r)->asking -= reqs[k].amt;
+	 }
+      }
+      for (int j = 0; j < R; j++) {
+	 left[j] = bank->remaining[j];
+      }
+      granted = 0;
+      waiting = 0;
+      //every request is looked at afresh, since whether one is in
+      //error may depend on which earlier ones are granted
+      for (int k = 0; k < n; k++) {
+	 int i = reqs[k].i;
+	 claim *c = find_claim(i, reqs[k].r);
+	 int amt = reqs[k].amt;
+	 reqs[k].result = 1;
+	 if (waiting & (1u << i)) {
+	    continue;
+	 }
+	 if (!bank->thread_list[i].started) {
+	    reqs[k].result = -1;
+	    continue;
+	 }
+	 if (amt == 0) {
+	    reqs[k].result = 0;
+	    granted++;
+	    continue;
+	 }
+	 if (c == NULL || c->max < (amt + c->asking + c->allocated)) {
+	    reqs[k].result = -1;
+	    continue;
+	 }
+	 if (amt <= left[reqs[k].r]) {
+	    c->asking += amt;
+	    left[reqs[k].r] -= amt;
+	    if (fast_safe(i, left) || bankers()) {
+	       reqs[k].result = 0;
+	       granted++;
+	    } else {
+	       c->asking -= amt;
+	       left[reqs[k].r] += amt;
+	    }
+	 }
+	 if (reqs[k].result == 1) {
+	    waiting |= 1u << i;
+	 }
+      }
+   }
+
+   //make the granted allocations
+   for (int k = 0; k < n; k++) {
+      if (reqs[k].result == 0 && reqs[k].amt > 0) {
+	 claim *c = find_claim(reqs[k].i, reqs[k].r);
+	 c->asking -= reqs[k].amt;
+	 c->allocated += reqs[k].amt;
+	 bank->remaining[reqs[k].r] -= reqs[k].amt;
+      }
+   }
+   pthread_mutex_unlock(&bank->is_remain);
+   return granted;
+}
+
+/***********************************************************
+ * int release(int, int, int)
  * Pre: i, amt, and r are valid ints
- * Post: the amt will be released to the remaining array
+ * Post: the amt will be released to the remaining array.
+ * Returns 0, or -1 on error
  *********************************************************/
 
-void release(int i, int r, int amt) {
+int release(int i, int r, int amt) {
 
+   int err = 0;
    //more than one thread should not release at the same time
    if (amt > 0) {
-      pthread_mutex_lock(&is_remain);
-      thread_list[i].res[r].allocated -= amt;
-      remaining[r] += amt;
-      pthread_cond_broadcast(&s);
-      pthread_mutex_unlock(&is_remain);
+      sim_yield();
+      lock_bank();
+      claim *c = find_claim(i, r);
+      if (c == NULL || amt > c->allocated) {
+	 printf("Error: can't release more than was allocated\n");
+	 err = -1;
+      } else {
+	 c->allocated -= amt;
+	 bank->remaining[r] += amt;
+	 sim_cond_broadcast(&bank->s);
+      }
+      pthread_mutex_unlock(&bank->is_remain);
    }
+   return err;
+}
+
+/***********************************************************
+ * int holding(int, int)
+ * Pre: i and r are valid ints
+ * Post: the amount of r allocated to thread i is returned
+ *********************************************************/
+int holding(int i, int r) {
+   lock_bank();
+   claim *c = find_claim(i, r);
+   int amt = c == NULL ? 0 : c->allocated;
+   pthread_mutex_unlock(&bank->is_remain);
+   return amt;
 }
 
 /***********************************************************
  * void finished(int)
  * Pre: i is a valid int
  * Post: all of process i's resources will be returned to
- * the remaining array and the thread will exit
+ * the remaining array, its maxes are cleared and slot i
+ * is handed back to be reused by a later client. This is
+ * done in one critical section with a single wakeup, so 
+ * waiters never see a partly released thread
  *********************************************************/
 void finished(int i) {
 
-   for (int j = 0; j < R; j++) {
-      release(i, j, thread_list[i].res[j].allocated);
+   sim_yield();
+   lock_bank();
+   clear_slot(i);
+   pthread_mutex_unlock(&bank->is_remain);
+
+}
+
+/***********************************************************
+ * void clear_slot(int)
+ * Pre: the banker's lock is held and slot i is in use
+ * Post: slot i's resources are returned, its maxes are
+ * cleared, the waiters are woken and the slot is free
+ *********************************************************/
+void clear_slot(int i) {
+   //unhook the list first, so that if we die part way through the
+   //claims are lost to everyone until repair() finds them, rather
+   //than counted twice
+   int c = bank->thread_list[i].claims;
+   bank->thread_list[i].claims = -1;
+   while (c >= 0) {
+      claim *p = &bank->pool[c];
+      int next = p->next;
+      bank->remaining[p->r] += p->allocated;
+      bank->holders[p->r] &= ~(1u << i);
+      p->next = bank->free_claim;
+      bank->free_claim = c;
+      c = next;
+   }
+   bank->thread_list[i].started = false;
+   //even if nothing was held, a finished thread no longer counts
+   //against the safety check, so the waiters may be able to go now
+   sim_cond_broadcast(&bank->s);
+   putslot(i);
+}
+
+/***********************************************************
+ * int getslot()
+ * Pre: none
+ * Post: a free slot is marked as in use and its id is 
+ * returned, or -1 is returned if all N slots are taken.
+ * This never blocks, except that a shared banker with no
+ * free slot first takes the lock to reclaim the slots of
+ * dead processes
+ *********************************************************/
+int getslot() {
+   int i = takeslot();
+   if (i < 0 && shared) {
+      lock_bank();
+      reap();
+      pthread_mutex_unlock(&bank->is_remain);
+      i = takeslot();
+   }
+   return i;
+}
+
+/***********************************************************
+ * int takeslot()
+ * Pre: none
+ * Post: the first free slot is claimed and its id is 
+ * returned, or -1 if there is none. The slot is claimed by
+ * a compare-and-swap of this process's pid into its owner,
+ * so a slot is never in use without an owner for reap() to
+ * check
+ *********************************************************/
+int takeslot() {
+   pid_t me = getpid();
+   for (int i = 0; i < N; i++) {
+      pid_t old = 0;
+      if (__atomic_load_n(&bank->thread_list[i].owner, __ATOMIC_RELAXED) == 0 &&
+	  __atomic_compare_exchange_n(&bank->thread_list[i].owner, &old, me, false,
+				      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	 return i;
+      }
+      //either in use, or some other thread just took it
    }
-   thread_list[i].started = false;
-   pthread_exit(NULL);
+   return -1;
+}
 
+/***********************************************************
+ * void putslot(int)
+ * Pre: i is a slot handed out by getslot() whose client
+ * has finished
+ * Post: slot i is marked free so getslot() may reuse it
+ *********************************************************/
+void putslot(int i) {
+   __atomic_store_n(&bank->thread_list[i].owner, 0, __ATOMIC_RELEASE);
 }
 
 /***********************************************************
- * void bankers()
+ * bool bankers()
  * Pre: the maxes are all set for the threads that have 
- * been started
+ * been started, and each claim's asking amount is what
+ * the thread would like on top of what it has
  * Post: true or false will be returned based on 
- * whether or not the threads can safely finish
+ * whether or not the threads could safely finish if 
+ * those amounts were allocated
  *********************************************************/
 
 bool bankers() {
 
-   node *current = NULL;
-   node *head = NULL;
-   int t_started = 0;
-   int num_t = 0;
+   int temp_remain[R];
+   for (int j = 0; j < R; j++) {
+      temp_remain[j] = bank->remaining[j];
+   }
+   unsigned int left = 0; //threads that have not finished yet
    for (int i = 0; i < N; i++) {
-      if (thread_list[i].started) {
-	 if (head == NULL) {
-	    head = new node();
-	    head->id = i;
-	    current = head;
-	    current->prev = NULL;
-	    current->next = NULL;
-	 } else {
-	    current->next = new node();
-	    current->next->prev = current;
-	    current = current->next;
-	    current->id = i;
-	    current->next = NULL;
+      if (bank->thread_list[i].started) {
+	 left |= 1u << i;
+	 for (int c = bank->thread_list[i].claims; c >= 0; c = bank->pool[c].next) {
+	    temp_remain[bank->pool[c].r] -= bank->pool[c].asking;
 	 }
-	 t_started++;
       }
    }
-      
-   num_t = t_started;
-
-   int temp_remain[R];
-   for (int i = 0; i < R; i++) {
-      temp_remain[i] = remaining[i];
-   }
 
+   //a thread that can't finish yet only needs another look once a
+   //thread sharing one of its resources finishes and gives it back
+   unsigned int check = left;
    int exec_list[N];
    int p_count = 0;
-   bool deleted = false;
-   bool madeMoves = false;
-
-   while (true) {
-      node * c = head;
-      madeMoves = false;
-      //go back around again 
-      //if you go through the whole thing and dont make any progress - thats when its bad 
-      while(c != NULL) {
-	 deleted = false;
-	 for (int j = 0; j < R; j++) {
-	    int ask = thread_list[c->id].res[j].max - thread_list[c->id].res[j].allocated;
-	    if (ask > temp_remain[j]) {
-	       break;
-	    }
-	    if (j == R-1) {
-	       exec_list[p_count] = c->id;
-	       p_count++;
-	       release_temp(c->id, temp_remain, head, c);
-	       deleted = true;
-	       t_started--;
-	       madeMoves = true;
+   while (check != 0) {
+      int i = __builtin_ctz(check);
+      check &= ~(1u << i);
+      bool fits = true;
+      for (int c = bank->thread_list[i].claims; fits && c >= 0; c = bank->pool[c].next) {
+	 claim *p = &bank->pool[c];
+	 fits = p->max - p->allocated - p->asking <= temp_remain[p->r];
+      }
+      if (fits) {
+	 exec_list[p_count] = i;
+	 p_count++;
+	 left &= ~(1u << i);
+	 for (int c = bank->thread_list[i].claims; c >= 0; c = bank->pool[c].next) {
+	    claim *p = &bank->pool[c];
+	    if (p->allocated + p->asking > 0) {
+	       temp_remain[p->r] += p->allocated + p->asking;
+	       check |= bank->holders[p->r] & left;
 	    }
 	 }
-	 if (!deleted) {
-	    c = c->next;
-	 }
       }
-      if (head == NULL) {
-	 printf("State is safe! processes could finish in this order:\n");
-	 for (int i = 0; i < p_count; i++) {
-	    printf("%d ", exec_list[i]);
-	 }
-	 printf("\n");
-	 return true;
+   }
+
+   if (left == 0) {
+      TRACE("State is safe! processes could finish in this order:\n");
+      for (int i = 0; i < p_count; i++) {
+	 TRACE("%d ", exec_list[i]);
       }
-      if (!madeMoves && c == NULL) {
-	 printf("This state is unsafe\n");
+      TRACE("\n");
+      return true;
+   }
+   TRACE("This state is unsafe\n");
+   return false;
+}
+
+/***********************************************************
+ * bool fast_safe(int, const int *)
+ * Pre: the state was safe before thread i asked for more,
+ * and avail is what would remain if every ask was granted
+ * Post: true is returned if thread i could then get all 
+ * it might still want. If so, the new state is safe too:
+ * i can finish first and give back all it has, leaving
+ * the others more than they had before. Only i's own
+ * claims are looked at. False means the full check is
+ * needed
+ *********************************************************/
+bool fast_safe(int i, const int *avail) {
+   for (int c = bank->thread_list[i].claims; c >= 0; c = bank->pool[c].next) {
+      claim *p = &bank->pool[c];
+      if (p->max - p->allocated - p->asking > avail[p->r]) {
 	 return false;
       }
    }
+   return true;
 }
 
 /***********************************************************
- * void release_temp(int, int*, node*&, node*&)
- * Pre: i, amt, and r are valid ints, and current is 
- * the node we want to remove and release
- * Post: the node will be deleted from the doubly linked
- * list 
+ * int init_state(banker_state *, bool)
+ * Pre: b points to memory no other thread is using yet
+ * Post: b holds an empty banker with every resource
+ * remaining. If pshared, the mutex and condition variable
+ * work across processes and the mutex is robust. Returns
+ * 0, or -1 on error
  *********************************************************/
-void release_temp(int i, int *temp, node *&head, node *&current) {
+int init_state(banker_state *b, bool pshared) {
+   if (init_locks(b, pshared)) {
+      return -1;
+   }
+   for (int i = 0; i < R; i++) {
+      b->remaining[i] = TOTAL[i];
+   }
+   memset(b->thread_list, 0, sizeof(b->thread_list));
+   for (int i = 0; i < N; i++) {
+      b->thread_list[i].claims = -1;
+   }
    for (int j = 0; j < R; j++) {
-      temp[j] += thread_list[i].res[j].allocated;
-   }
-   //what about when we delete this and then move current? 
-   node *d = current;
-   if (current == head) {
-      d = head;
-      head = head->next;
-      if (head != NULL) {
-	 head->prev = NULL;
-	 d->next = NULL;
+      b->holders[j] = 0;
+   }
+   for (int k = 0; k < CLAIMS; k++) {
+      b->pool[k].next = k + 1 < CLAIMS ? k + 1 : -1;
+   }
+   b->free_claim = CLAIMS > 0 ? 0 : -1;
+   b->version = BANKER_VERSION;
+   b->size = sizeof(banker_state);
+   __atomic_store_n(&b->magic, BANKER_MAGIC, __ATOMIC_RELEASE);
+   return 0;
+}
+
+/***********************************************************
+ * int init_locks(banker_state *, bool)
+ * Pre: no other thread is using b
+ * Post: b's mutex and condition variable are initialized,
+ * to work across processes and with a robust mutex if 
+ * pshared. Returns 0, or -1 on error
+ *********************************************************/
+int init_locks(banker_state *b, bool pshared) {
+   pthread_mutexattr_t ma;
+   pthread_condattr_t ca;
+   pthread_mutexattr_init(&ma);
+   pthread_condattr_init(&ca);
+   if (pshared) {
+      pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+      pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+      pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+   }
+
+   if (pthread_mutex_init(&b->is_remain, &ma)) {
+      printf("Error: unable to initalize mutex\n");
+      return -1;
+   }
+     
+   if (pthread_cond_init(&b->s, &ca)) {
+      printf("Error unable to initalize the semaphore\n");
+      return -1;
+   }
+   pthread_mutexattr_destroy(&ma);
+   pthread_condattr_destroy(&ca);
+   return 0;
+}
+
+/***********************************************************
+ * int check_layout(banker_state *, const char *)
+ * Pre: b has been initialized by some process
+ * Post: 0 is returned if b was laid out by this version of
+ * the banker, otherwise an error naming where b came from
+ * is printed and -1 is returned
+ *********************************************************/
+int check_layout(banker_state *b, const char *where) {
+   if (b->magic != BANKER_MAGIC || b->version != BANKER_VERSION ||
+       b->size != sizeof(banker_state)) {
+      printf("Error: %s holds version %u of the banker's tables, expected %u\n",
+	     where, b->version, BANKER_VERSION);
+      return -1;
+   }
+   return 0;
+}
+
+/***********************************************************
+ * int banker_init()
+ * Pre: no other banker function has been called yet
+ * Post: the banker's tables are set up in this process.
+ * Returns 0, or -1 on error
+ *********************************************************/
+int banker_init() {
+   return init_state(&local_bank, false);
+}
+
+/***********************************************************
+ * int banker_share(const char *)
+ * Pre: no other banker function has been called yet
+ * Post: the banker's tables are in the shared memory
+ * object name, which is created and initialized if this is
+ * the first process to use it. Returns 0, or -1 on error
+ *********************************************************/
+int banker_share(const char *name) {
+   int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+   if (fd < 0) {
+      printf("Error: unable to open shared memory %s\n", name);
+      return -1;
+   }
+   //whoever holds the lock sets the object up, while the others
+   //wait. If it dies part way, the lock is dropped with its fd and
+   //the next process finds magic still 0 and starts over
+   if (flock(fd, LOCK_EX)) {
+      printf("Error: unable to lock shared memory %s\n", name);
+      close(fd);
+      return -1;
+   }
+   struct stat st;
+   if (fstat(fd, &st) || (st.st_size == 0 && ftruncate(fd, sizeof(banker_state)))) {
+      printf("Error: unable to size shared memory %s\n", name);
+      close(fd);
+      return -1;
+   }
+   if (st.st_size != 0 && st.st_size != (off_t)sizeof(banker_state)) {
+      printf("Error: shared memory %s has the wrong size\n", name);
+      close(fd);
+      return -1;
+   }
+
+   void *p = mmap(NULL, sizeof(banker_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (p == MAP_FAILED) {
+      printf("Error: unable to map shared memory %s\n", name);
+      close(fd);
+      return -1;
+   }
+   banker_state *b = (banker_state *)p;
+
+   int err = b->magic == 0 ? init_state(b, true) : check_layout(b, name);
+   close(fd); //also drops the lock
+   if (err) {
+      return -1;
+   }
+   bank = b;
+   shared = true;
+   return 0;
+}
+
+/***********************************************************
+ * int banker_restore(const char *, unsigned int *)
+ * Pre: no other banker function has been called yet
+ * Post: the banker's tables are mapped from the file path,
+ * and are either new, or just as the last process using
+ * the file left them. The slots in use are stored in
+ * inuse. Returns 0, or -1 on error
+ *********************************************************/
+int banker_restore(const char *path, unsigned int *inuse) {
+   int fd = open(path, O_RDWR | O_CREAT, 0600);
+   if (fd < 0) {
+      printf("Error: unable to open %s\n", path);
+      return -1;
+   }
+   //the lock is held for as long as the process lives, since fd is kept
+   if (flock(fd, LOCK_EX | LOCK_NB)) {
+      printf("Error: %s is in use by another banker\n", path);
+      close(fd);
+      return -1;
+   }
+   struct stat st;
+   if (fstat(fd, &st) || (st.st_size == 0 && ftruncate(fd, sizeof(banker_state)))) {
+      printf("Error: unable to size %s\n", path);
+      close(fd);
+      return -1;
+   }
+   if (st.st_size != 0 && st.st_size != (off_t)sizeof(banker_state)) {
+      printf("Error: %s was not written by this version of the banker\n", path);
+      close(fd);
+      return -1;
+   }
+
+   void *p = mmap(NULL, sizeof(banker_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (p == MAP_FAILED) {
+      printf("Error: unable to map %s\n", path);
+      close(fd);
+      return -1;
+   }
+   banker_state *b = (banker_state *)p;
+
+   if (b->magic == 0) {
+      //a new file, or one whose first process died setting it up
+      if (init_state(b, true)) {
+	 return -1;
       }
-      current = head;
-      delete d;
+      bank = b;
    } else {
-      node *p = current->prev;
-      p->next = current->next;
-      if (current->next != NULL) {
-	 current->next->prev = p;
+      if (check_layout(b, path)) {
+	 return -1;
+      }
+      //whoever used the locks before is gone, so start them afresh,
+      //and redo remaining in case it died part way through an update
+      if (init_locks(b, true)) {
+	 return -1;
+      }
+      bank = b;
+      repair();
+   }
+   *inuse = 0;
+   for (int i = 0; i < N; i++) {
+      if (b->thread_list[i].owner != 0) {
+	 b->thread_list[i].owner = getpid();
+	 *inuse |= 1u << i;
+      }
+   }
+   if (*inuse != 0) {
+      TRACE("restored %d clients from %s\n", __builtin_popcount(*inuse), path);
+   }
+   return 0;
+}
+
+/***********************************************************
+ * void lock_bank()
+ * Pre: the calling thread doesn't hold the banker's lock
+ * Post: it does now. If the last holder died while holding
+ * it, the tables have been repaired. If the lock can't be
+ * had at all, e.g. because a process died while recovering
+ * it, the program exits rather than go on unlocked
+ *********************************************************/
+void lock_bank() {
+   int err = pthread_mutex_lock(&bank->is_remain);
+   if (err == EOWNERDEAD) {
+      recover();
+   } else if (err) {
+      printf("Error: unable to lock the banker's tables: %s\n", strerror(err));
+      exit(1);
+   }
+}
+
+/***********************************************************
+ * void wait_bank()
+ * Pre: the banker's lock is held
+ * Post: the tables may have changed and the lock is held
+ * again. A shared banker wakes up every 100 ms to reclaim
+ * the resources of dead processes, since they will never
+ * release them
+ *********************************************************/
+void wait_bank() {
+   if (!shared) {
+      sim_cond_wait(&bank->s, &bank->is_remain);
+      return;
+   }
+   timespec t;
+   clock_gettime(CLOCK_REALTIME, &t);
+   t.tv_nsec += 100000000;
+   if (t.tv_nsec >= 1000000000) {
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000;
+   }
+   int err = pthread_cond_timedwait(&bank->s, &bank->is_remain, &t);
+   if (err == EOWNERDEAD) {
+      recover();
+   } else if (err == ETIMEDOUT) {
+      reap();
+   } else if (err) {
+      printf("Error: unable to lock the banker's tables: %s\n", strerror(err));
+      exit(1);
+   }
+}
+
+/***********************************************************
+ * void recover()
+ * Pre: the banker's lock was just taken over from a
+ * process that died holding it
+ * Post: the tables are repaired, in case the dead process
+ * was half way through an update, and dead processes are
+ * reaped
+ *********************************************************/
+void recover() {
+   //done first, since dying before this leaves the lock unusable
+   pthread_mutex_consistent(&bank->is_remain);
+   printf("Error: a process died holding the banker's lock, recovering\n");
+   repair();
+   reap();
+}
+
+/***********************************************************
+ * void repair()
+ * Pre: nobody else is using the tables
+ * Post: the remaining array, the holders and the free
+ * list are rebuilt from each thread's claims, and any asks
+ * are dropped. The claims only ever hold granted 
+ * allocations, so this makes the tables consistent even if
+ * the last update stopped half way
+ *********************************************************/
+void repair() {
+   bool used[CLAIMS];
+   memset(used, 0, sizeof(used));
+   for (int j = 0; j < R; j++) {
+      bank->remaining[j] = TOTAL[j];
+      bank->holders[j] = 0;
+   }
+   for (int i = 0; i < N; i++) {
+      for (int c = bank->thread_list[i].claims; c >= 0; c = bank->pool[c].next) {
+	 claim *p = &bank->pool[c];
+	 used[c] = true;
+	 p->asking = 0;
+	 bank->remaining[p->r] -= p->allocated;
+	 bank->holders[p->r] |= 1u << i;
+      }
+   }
+   bank->free_claim = -1;
+   for (int k = CLAIMS - 1; k >= 0; k--) {
+      if (!used[k]) {
+	 bank->pool[k].next = bank->free_claim;
+	 bank->free_claim = k;
+      }
+   }
+}
+
+/***********************************************************
+ * void reap()
+ * Pre: the banker's lock is held
+ * Post: every slot owned by a process that no longer
+ * exists is cleared, returning what it held
+ *********************************************************/
+void reap() {
+   for (int i = 0; i < N; i++) {
+      pid_t owner = __atomic_load_n(&bank->thread_list[i].owner, __ATOMIC_ACQUIRE);
+      if (owner != 0 && owner != getpid() &&
+	  kill(owner, 0) < 0 && errno == ESRCH) {
+	 printf("Error: process %d died, reclaiming slot %d\n", (int)owner, i);
+	 clear_slot(i);
       }
-      current = current->next;
-      d->next = NULL;
-      d->prev = NULL;
-      delete d;
    }
 }
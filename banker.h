@@ -6,9 +6,12 @@
 // This header file defines some constants for the resources.
 
 
-// There are at most N=5 threads competing for resources.
+// There are at most N=5 threads competing for resources at any one time.
 #define N 5
 
+// Sets of thread IDs are kept as bits of an unsigned int, e.g. 1u << i.
+static_assert(N < 32, "N must fit in the bits of an unsigned int");
+
 // There are R=4 resources: keyboard, disk, memory, and network connections
 #define R 4
 
@@ -24,6 +27,24 @@ const char * const RNAME[] = { "keyboard", "disk space", "memory pages", "networ
 // Total amount of each resource in the system. This never changes.
 const int TOTAL[] = { 1,  50000, 1000, 100 };
 
+// Only the resources a thread calls setmax() for take up room in the banker's
+// tables. There is room for CLAIMS of them at a time, among all threads, in a
+// pool of fixed size, so the tables can live in shared memory or a file. The
+// default of N*R lets every thread claim every resource, as the scenarios do,
+// but it saves no memory: a claim is larger than an entry of a plain N by R
+// table. When most threads only use a few of the resources, set it to about N
+// times the claims of a typical client, e.g. with -DCLAIMS=... when compiling.
+// The safety check only looks at the claims that exist, whatever the size.
+#ifndef CLAIMS
+#define CLAIMS (N * R)
+#endif
+
+// The banker and the scenarios narrate what they are doing using TRACE(), which
+// works just like printf(). Setting verbose to false silences the narration,
+// but not error messages, e.g. when running many simulations back to back.
+extern bool verbose;
+#define TRACE(...) do { if (verbose) printf(__VA_ARGS__); } while (0)
+
 
 // The five functions below make up the Banker's algorithm. In each scenario for
 // testing, up to five different threads will call all of these functions,
@@ -44,14 +65,21 @@ const int TOTAL[] = { 1,  50000, 1000, 100 };
 //
 // * It is an error for a thread to call this after it has called starting().
 // * It is an error for a thread to call this with amt > TOTAL[r].
-void setmax(int i, int r, int amt);
+// * The call fails if this would be the thread's first claim on _r_ and all
+//   CLAIMS claims are already taken, in which case the thread has no claim on
+//   _r_ and may not allocate it.
+//
+// Returns 0, or -1 if the call was in error or failed and nothing was changed.
+int setmax(int i, int r, int amt);
 
 // Function starting() will be called by thread _i_ after it done calling
 // setmax() and before it calls any of the other functions below.
 //
 // * It is an error for a thread to call this after it has previously called
 //   starting().
-void starting(int i);
+//
+// Returns 0, or -1 if the call was in error.
+int starting(int i);
 
 // Thread _i_ calls alloc() to allocate amount _amt_ of resource _r_.
 // The banker's algorithm should first check if this allocation could
@@ -80,14 +108,76 @@ void alloc(int i, int r, int amt);
 //   previously.
 // * It is an error for _amt_ to exceed the total previous amounts of this
 //   resource allocated by this thread.
-void release(int i, int r, int amt);
-
-// Thread _i_ calls finished() to exit and relinquish any remaining resources it
-// still holds. The banker's algorithm should update its bookkeeping as needed,
-// just as if release() was called for any resources this thread still holds.
-// Then, the function will cause the current thread to exit by calling
-// pthread_exit(NULL). This ensures the thread is dead and none of the other
-// funtions will be called again by this thread.
+//
+// Returns 0, or -1 if the call was in error and nothing was released.
+int release(int i, int r, int amt);
+
+// Thread _i_ calls finished() to relinquish any remaining resources it still
+// holds. The banker's algorithm should update its bookkeeping as needed, just as
+// if release() was called for any resources this thread still holds. Then the
+// maximums for _i_ are forgotten and the ID _i_ is handed back, so a later call
+// to getslot() may give it to a new client. The function returns normally, so
+// the calling thread is free to go on and serve another client under a new ID,
+// but it must not use _i_ again.
 void finished(int i);
 
+// holding() returns the amount of resource _r_ currently allocated to thread
+// _i_, or 0 if it has no claim on _r_.
+int holding(int i, int r);
+
+// getslot() hands out an unused client ID _i_, with 0 <= i < N, for use with
+// the functions above. It returns -1 if all N IDs are currently in use. An ID
+// stays in use until its client calls finished(). This never blocks, except
+// that with banker_share(), when all N IDs are in use, it first takes the
+// banker's lock to reclaim the IDs of processes that have died.
+int getslot();
+
+// A request for thread _i_ to allocate _amt_ of resource _r_, for try_alloc().
+// On return, _result_ is 0 if the request was granted, 1 if it would have had to
+// wait, or -1 if it was in error (see alloc() for what counts as an error).
+struct alloc_req {
+   int i;
+   int r;
+   int amt;
+   int result;
+};
+
+// try_alloc() is like calling alloc() for each of the _n_ requests in _reqs_,
+// except that it never waits. Requests that are safe are granted, in order, and
+// the rest are left for the caller to try again later, e.g. after a release().
+// Requests for the same thread are kept in order: once one of them has to wait,
+// the later ones for that thread wait too, even if they would be safe.
+// All of the requests are first tried together, with a single run of the
+// safety check, and only if that is unsafe are they tried one by one. Returns
+// the number of requests granted.
+int try_alloc(alloc_req *reqs, int n);
+
+// banker_init() sets up the banker's tables in this process's own memory.
+// Returns 0 on success, or -1 on error.
+int banker_init();
+
+// Normally the banker's tables are private to this process. banker_share()
+// moves them into the POSIX shared memory object _name_, e.g. "/banker",
+// creating and initializing it if this is the first process to use it, so that
+// threads in several processes are all checked by the same banker and share the
+// same N IDs. If a process dies, the resources still held by its threads are
+// reclaimed by the others. Returns 0 on success, or -1 on error.
+int banker_share(const char *name);
+
+// banker_restore() keeps the banker's tables in the file _path_, mapped into
+// memory, so that they outlive this process. If the file is new, the banker
+// starts out empty, just as with banker_init(). Otherwise the tables are picked
+// up just as the last process to use the file left them, with the same IDs in
+// use and the same maximums and allocations for each, which takes the same
+// short time no matter how many calls led up to that state. The IDs in use are
+// stored in _inuse_, bit i for ID i, so the caller can give them back to their
+// clients. Only one process may use the file at a time, and it must have been
+// written by this version of the banker. The file survives the process
+// crashing, but not necessarily the machine. Returns 0 on success, or -1 on
+// error.
+int banker_restore(const char *path, unsigned int *inuse);
+
+// One of banker_init(), banker_share() or banker_restore() must be called once,
+// before any of the other functions above.
+
 #endif // BANKER_H
@@ -0,0 +1,479 @@
+/********************************************************
+ * bankerd.cc
+ * Purpose: to serve the banker to other processes over
+ * a Unix domain socket, see proto.h for the protocol.
+ * usage: bankerd [-S socket] [-f file] [-g seconds] [-q]
+ *
+ * The daemon is a single thread driven by poll(). After
+ * each round of reading, every queued request that can
+ * go ahead is carried out, and all of the queued allocs
+ * are handed to try_alloc() together, so that a whole
+ * batch is decided by one run of the safety check. Allocs
+ * that can't be granted stay queued and are only tried
+ * again after something is released or finished.
+ *
+ * With -f, the tables are kept in a file, so a restarted
+ * bankerd carries on with the grants made before. The
+ * IDs in use at the restart are orphans until a client
+ * attaches to them again. Orphans still unclaimed after
+ * the grace period set by -g are finished, so what they
+ * held goes back to the others.
+ *******************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "banker.h"
+#include "proto.h"
+
+// At most MAXCONN connections, each with at most QMAX requests queued or
+// replies unsent. A connection that reaches QMAX isn't read from until it
+// catches up.
+#define MAXCONN 64
+#define QMAX 256
+
+struct conn {
+   int fd;                             // -1 if this entry is unused
+   unsigned int owned;                 // bit i is set for each client ID it holds
+   char in[QMAX * sizeof(bank_msg)];   // bytes read but not yet queued
+   int in_len;
+   bank_msg queue[QMAX];               // requests not yet answered, oldest first
+   bool done[QMAX];                    // answered, to be removed from queue
+   bool tried[QMAX];                   // an alloc already handed to try_alloc()
+   int queued;
+   char out[QMAX * sizeof(bank_msg)];  // replies not yet written
+   int out_len;
+};
+
+conn conns[MAXCONN];
+alloc_req batch[MAXCONN * QMAX];
+int batch_conn[MAXCONN * QMAX];
+int batch_pos[MAXCONN * QMAX];
+unsigned int orphans = 0; // IDs in use before a restart, not yet attached
+bool dirty = false;       // resources came back since the parked allocs were tried
+long orphan_deadline = 0; // when the orphans left are finished, in ms
+long served = 0;
+long batches = 0;
+volatile sig_atomic_t stopping = 0;
+
+void serve();
+void serve_one(conn *, int);
+void reply(conn *, int, int);
+int room(conn *);
+void read_conn(conn *);
+void write_conn(conn *);
+void close_conn(conn *);
+void stop(int);
+long now_ms();
+
+int main(int argc, char **argv) {
+
+   const char *path = BANK_SOCKET;
+   const char *file = NULL;
+   int grace = 60;
+   int opt;
+   while ((opt = getopt(argc, argv, "S:f:g:q")) != -1) {
+      switch (opt) {
+      case 'S':
+	 path = optarg;
+	 break;
+      case 'f':
+	 file = optarg;
+	 break;
+      case 'g':
+	 grace = atoi(optarg);
+	 break;
+      case 'q':
+	 verbose = false;
+	 break;
+      default:
+	 printf("usage: %s [-S socket] [-f file] [-g seconds] [-q]\n", argv[0]);
+	 return -1;
+      }
+   }
+   if (grace < 0) {
+      printf("Error: bad arguments\n");
+      return -1;
+   }
+
+   if (file != NULL) {
+      if (banker_restore(file, &orphans)) {
+	 return -1;
+      }
+      orphan_deadline = now_ms() + grace * 1000L;
+   } else if (banker_init()) {
+      return -1;
+   }
+
+   int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+   sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+   unlink(path);
+   if (lfd < 0 || bind(lfd, (sockaddr *)&addr, sizeof(addr)) || listen(lfd, 64)) {
+      printf("Error: unable to listen on %s\n", path);
+      return -1;
+   }
+   fcntl(lfd, F_SETFL, O_NONBLOCK);
+
+   signal(SIGPIPE, SIG_IGN);
+   signal(SIGINT, &stop);
+   signal(SIGTERM, &stop);
+   for (int c = 0; c < MAXCONN; c++) {
+      conns[c].fd = -1;
+   }
+   printf("bankerd listening on %s\n", path);
+   fflush(stdout);
+
+   pollfd fds[MAXCONN + 1];
+   int who[MAXCONN + 1];
+   while (!stopping) {
+      int nfds = 0;
+      fds[nfds].fd = lfd;
+      fds[nfds].events = POLLIN;
+      nfds++;
+      for (int c = 0; c < MAXCONN; c++) {
+	 if (conns[c].fd >= 0) {
+	    fds[nfds].fd = conns[c].fd;
+	    fds[nfds].events = (room(&conns[c]) > 0 ? POLLIN : 0) |
+			       (conns[c].out_len > 0 ? POLLOUT : 0);
+	    who[nfds] = c;
+	    nfds++;
+	 }
+      }
+      //with orphans left, wake up in time to finish them
+      int timeout = -1;
+      if (orphans != 0) {
+	 long wait = orphan_deadline - now_ms();
+	 timeout = wait < 0 ? 0 : (int)wait;
+      }
+      if (poll(fds, nfds, timeout) < 0) {
+	 continue; //interrupted by a signal
+      }
+      if (orphans != 0 && now_ms() >= orphan_deadline) {
+	 TRACE("finishing %d clients that never attached\n", __builtin_popcount(orphans));
+	 for (int i = 0; i < N; i++) {
+	    if (orphans & (1u << i)) {
+	       finished(i);
+	    }
+	 }
+	 orphans = 0;
+	 dirty = true;
+      }
+
+      if (fds[0].revents & POLLIN) {
+	 int fd;
+	 while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+	    int c = 0;
+	    while (c < MAXCONN && conns[c].fd >= 0) {
+	       c++;
+	    }
+	    if (c == MAXCONN) {
+	       printf("Error: too many connections\n");
+	       close(fd);
+	       continue;
+	    }
+	    fcntl(fd, F_SETFL, O_NONBLOCK);
+	    memset(&conns[c], 0, sizeof(conn));
+	    conns[c].fd = fd;
+	 }
+      }
+      for (int k = 1; k < nfds; k++) {
+	 conn *cn = &conns[who[k]];
+	 if ((fds[k].revents & (POLLHUP | POLLERR)) && room(cn) <= 0) {
+	    //a full connection isn't read, so the hangup would
+	    //be reported again on every poll, and nobody is
+	    //left to take the replies anyway
+	    close_conn(cn);
+	 } else if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+	    read_conn(cn);
+	 }
+      }
+
+      serve();
+
+      for (int c = 0; c < MAXCONN; c++) {
+	 if (conns[c].fd >= 0 && conns[c].out_len > 0) {
+	    write_conn(&conns[c]);
+	 }
+      }
+   }
+
+   unlink(path);
+   printf("bankerd served %ld requests, with %ld batches of allocs\n", served, batches);
+   return 0;
+}
+
+/***********************************************************
+ * void serve()
+ * Pre: the queues hold the requests read so far
+ * Post: every request that can go ahead has been carried
+ * out and answered. Allocs that must wait stay queued, and
+ * are only tried again once something has been given back
+ *********************************************************/
+void serve() {
+   bool progress = true;
+   while (progress) {
+      progress = false;
+      //a parked alloc can only be granted after a release, so
+      //otherwise just the new allocs are tried
+      bool retry = dirty;
+      dirty = false;
+      int nb = 0;
+      for (int c = 0; c < MAXCONN; c++) {
+	 conn *cn = &conns[c];
+	 unsigned int batched = 0; //IDs with allocs in this batch
+	 unsigned int busy = 0;    //IDs with an earlier request still queued
+	 for (int k = 0; cn->fd >= 0 && k < cn->queued; k++) {
+	    bank_msg *m = &cn->queue[k];
+	    if (m->op == BANK_GETID || m->i < 0 || m->i >= N) {
+	       serve_one(cn, k);
+	       progress = true;
+	       continue;
+	    }
+	    unsigned int bit = 1u << m->i;
+	    if (busy & bit) {
+	       continue;
+	    }
+	    //try_alloc() keeps each ID's allocs in order, so a run of
+	    //them can all go in the batch
+	    bool alloc = m->op == BANK_ALLOC && (cn->owned & bit) && m->r < R && m->amt >= 0;
+	    if (alloc && cn->tried[k] && !retry) {
+	       //parked, and so is everything after it for this ID
+	       busy |= bit;
+	    } else if (alloc) {
+	       batch[nb].i = m->i;
+	       batch[nb].r = m->r;
+	       batch[nb].amt = m->amt;
+	       batch_conn[nb] = c;
+	       batch_pos[nb] = k;
+	       nb++;
+	       batched |= bit;
+	    } else if (batched & bit) {
+	       //must wait for the allocs before it
+	       busy |= bit;
+	    } else {
+	       serve_one(cn, k);
+	       progress = true;
+	    }
+	 }
+      }
+
+      if (nb > 0) {
+	 batches++;
+	 try_alloc(batch, nb);
+	 for (int b = 0; b < nb; b++) {
+	    conns[batch_conn[b]].tried[batch_pos[b]] = true;
+	    if (batch[b].result != 1) {
+	       reply(&conns[batch_conn[b]], batch_pos[b],
+		     batch[b].result == 0 ? BANK_OK : BANK_ERR);
+	       progress = true;
+	    }
+	 }
+      }
+
+      //drop the answered requests from the queues
+      for (int c = 0; c < MAXCONN; c++) {
+	 conn *cn = &conns[c];
+	 int kept = 0;
+	 for (int k = 0; k < cn->queued; k++) {
+	    if (!cn->done[k]) {
+	       cn->queue[kept] = cn->queue[k];
+	       cn->done[kept] = false;
+	       cn->tried[kept] = cn->tried[k];
+	       kept++;
+	    }
+	 }
+	 cn->queued = kept;
+      }
+   }
+}
+
+/***********************************************************
+ * void serve_one(conn *, int)
+ * Pre: request k of cn is not an alloc that may have to
+ * wait
+ * Post: the request is carried out and answered
+ *********************************************************/
+void serve_one(conn *cn, int k) {
+   bank_msg *m = &cn->queue[k];
+   if (m->op == BANK_GETID) {
+      m->i = getslot();
+      if (m->i < 0) {
+	 reply(cn, k, BANK_ERR);
+	 return;
+      }
+      cn->owned |= 1u << m->i;
+      reply(cn, k, BANK_OK);
+      return;
+   }
+   if (m->op == BANK_ATTACH) {
+      if (m->i < 0 || m->i >= N || !(orphans & (1u << m->i))) {
+	 reply(cn, k, BANK_ERR);
+	 return;
+      }
+      orphans &= ~(1u << m->i);
+      cn->owned |= 1u << m->i;
+      reply(cn, k, BANK_OK);
+      return;
+   }
+   //a connection may only use the IDs it was given
+   if (m->i < 0 || m->i >= N || !(cn->owned & (1u << m->i)) || m->r >= R || m->amt < 0) {
+      reply(cn, k, BANK_ERR);
+      return;
+   }
+   int err;
+   switch (m->op) {
+   case BANK_SETMAX:
+      err = setmax(m->i, m->r, m->amt);
+      break;
+   case BANK_STARTING:
+      err = starting(m->i);
+      break;
+   case BANK_RELEASE:
+      err = release(m->i, m->r, m->amt);
+      dirty = dirty || (err == 0 && m->amt > 0);
+      break;
+   case BANK_QUERY:
+      m->amt = holding(m->i, m->r);
+      err = 0;
+      break;
+   case BANK_FINISHED:
+      finished(m->i);
+      cn->owned &= ~(1u << m->i);
+      dirty = true;
+      err = 0;
+      break;
+   default:
+      err = -1;
+      break;
+   }
+   reply(cn, k, err ? BANK_ERR : BANK_OK);
+}
+
+/***********************************************************
+ * void reply(conn *, int, int)
+ * Pre: request k of cn has been carried out
+ * Post: its reply is buffered and the request is marked
+ * done
+ *********************************************************/
+void reply(conn *cn, int k, int status) {
+   bank_msg m = cn->queue[k];
+   m.status = status;
+   memcpy(cn->out + cn->out_len, &m, sizeof(m));
+   cn->out_len += sizeof(m);
+   cn->done[k] = true;
+   served++;
+}
+
+/***********************************************************
+ * int room(conn *)
+ * Pre: cn is in use
+ * Post: the number of bytes that may still be read from cn
+ * is returned. Every queued request and every unsent reply
+ * takes up one of the QMAX places
+ *********************************************************/
+int room(conn *cn) {
+   int used = cn->queued + cn->out_len / (int)sizeof(bank_msg);
+   return (QMAX - used) * (int)sizeof(bank_msg) - cn->in_len;
+}
+
+/***********************************************************
+ * void read_conn(conn *)
+ * Pre: cn is readable
+ * Post: all complete messages read are queued. If the
+ * client hung up, the connection is closed
+ *********************************************************/
+void read_conn(conn *cn) {
+   int want = room(cn);
+   if (want <= 0) {
+      return;
+   }
+   int got = read(cn->fd, cn->in + cn->in_len, want);
+   if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+      close_conn(cn);
+      return;
+   }
+   if (got < 0) {
+      return;
+   }
+   cn->in_len += got;
+   int used = 0;
+   while (cn->in_len - used >= (int)sizeof(bank_msg)) {
+      memcpy(&cn->queue[cn->queued], cn->in + used, sizeof(bank_msg));
+      cn->done[cn->queued] = false;
+      cn->tried[cn->queued] = false;
+      cn->queued++;
+      used += sizeof(bank_msg);
+   }
+   memmove(cn->in, cn->in + used, cn->in_len - used);
+   cn->in_len -= used;
+}
+
+/***********************************************************
+ * void write_conn(conn *)
+ * Pre: cn has replies buffered
+ * Post: as many as the socket would take are written. On
+ * error, the connection is closed
+ *********************************************************/
+void write_conn(conn *cn) {
+   int sent = write(cn->fd, cn->out, cn->out_len);
+   if (sent < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+	 close_conn(cn);
+      }
+      return;
+   }
+   memmove(cn->out, cn->out + sent, cn->out_len - sent);
+   cn->out_len -= sent;
+}
+
+/***********************************************************
+ * void close_conn(conn *)
+ * Pre: cn is in use
+ * Post: every ID cn still held is finished, its requests
+ * are dropped and the entry is free
+ *********************************************************/
+void close_conn(conn *cn) {
+   for (int i = 0; i < N; i++) {
+      if (cn->owned & (1u << i)) {
+	 finished(i);
+	 dirty = true;
+      }
+   }
+   close(cn->fd);
+   cn->fd = -1;
+   cn->owned = 0;
+   cn->queued = 0;
+   cn->in_len = 0;
+   cn->out_len = 0;
+}
+
+/***********************************************************
+ * void stop(int)
+ * Pre: SIGINT or SIGTERM arrived
+ * Post: the main loop will exit
+ *********************************************************/
+void stop(int sig) {
+   stopping = 1;
+}
+
+/***********************************************************
+ * long now_ms()
+ * Pre: none
+ * Post: a monotonic time in milliseconds is returned
+ *********************************************************/
+long now_ms() {
+   timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec * 1000L + t.tv_nsec / 1000000;
+}
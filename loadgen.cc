@@ -0,0 +1,276 @@
+/********************************************************
+ * loadgen.cc
+ * Purpose: to measure bankerd's throughput and latency.
+ * usage: loadgen [-S socket] [-c connections]
+ *           [-n clients per connection] [-o ops per client]
+ *           [-w window] [-s seed]
+ *
+ * Each connection runs in its own thread and plays out
+ * one client after another: it gets an ID, then sends
+ * the setmax, starting, alloc/release and finished
+ * requests for that client, keeping up to _window_ of
+ * them in flight at once. The time from sending each
+ * request to getting its reply is recorded.
+ *******************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "banker.h"
+#include "proto.h"
+
+struct gen {
+   int fd;
+   unsigned int seed;
+   long requests; // replies received
+   long errors;   // replies with BANK_ERR, other than busy getids
+   long retries;  // getids that found all N IDs in use
+   double *lat;   // latency of each request, in microseconds
+   long nlat;
+   long cap;      // room in lat
+};
+
+const char *path = BANK_SOCKET;
+int clients = 1000;
+int ops = 20;
+int window = 16;
+
+void *run_gen(void *);
+int run_client(gen *, bank_msg *, int);
+double now_us();
+int cmp_double(const void *, const void *);
+
+int main(int argc, char **argv) {
+
+   int nconn = 4;
+   unsigned int seed = 0;
+   int opt;
+   while ((opt = getopt(argc, argv, "S:c:n:o:w:s:")) != -1) {
+      switch (opt) {
+      case 'S': path = optarg; break;
+      case 'c': nconn = atoi(optarg); break;
+      case 'n': clients = atoi(optarg); break;
+      case 'o': ops = atoi(optarg); break;
+      case 'w': window = atoi(optarg); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      default:
+	 printf("usage: %s [-S socket] [-c connections] [-n clients per connection]\n"
+		"    [-o ops per client] [-w window] [-s seed]\n", argv[0]);
+	 return -1;
+      }
+   }
+   if (nconn < 1 || clients < 1 || ops < 0 || window < 1) {
+      printf("Error: bad arguments\n");
+      return -1;
+   }
+
+   gen *g = new gen[nconn];
+   pthread_t *id = new pthread_t[nconn];
+   for (int c = 0; c < nconn; c++) {
+      g[c].fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+      if (g[c].fd < 0 || connect(g[c].fd, (sockaddr *)&addr, sizeof(addr))) {
+	 printf("Error: unable to connect to %s\n", path);
+	 return -1;
+      }
+      g[c].seed = seed + c;
+      g[c].requests = 0;
+      g[c].errors = 0;
+      g[c].retries = 0;
+      g[c].nlat = 0;
+      g[c].cap = (long)clients * (ops + R + 3);
+      g[c].lat = new double[g[c].cap];
+   }
+
+   double start = now_us();
+   for (int c = 0; c < nconn; c++) {
+      pthread_create(&id[c], NULL, &run_gen, &g[c]);
+   }
+   long requests = 0, errors = 0, retries = 0, nlat = 0;
+   for (int c = 0; c < nconn; c++) {
+      pthread_join(id[c], NULL);
+      requests += g[c].requests;
+      errors += g[c].errors;
+      retries += g[c].retries;
+      nlat += g[c].nlat;
+   }
+   double secs = (now_us() - start) / 1e6;
+
+   double *lat = new double[nlat + 1];
+   long n = 0;
+   for (int c = 0; c < nconn; c++) {
+      memcpy(lat + n, g[c].lat, g[c].nlat * sizeof(double));
+      n += g[c].nlat;
+      close(g[c].fd);
+   }
+   qsort(lat, n, sizeof(double), &cmp_double);
+
+   printf("%ld requests (%ld errors, %ld busy getids) in %.3f s, %.0f requests/s\n",
+	  requests, errors, retries, secs, requests / secs);
+   if (n > 0) {
+      printf("latency us: p50 %.1f  p99 %.1f  max %.1f\n",
+	     lat[n / 2], lat[n * 99 / 100], lat[n - 1]);
+   }
+   return 0;
+}
+
+/***********************************************************
+ * void *run_gen(void *)
+ * Pre: the gen's socket is connected
+ * Post: all of this connection's clients have run
+ *********************************************************/
+void *run_gen(void *arg) {
+   gen *g = (gen *)arg;
+   bank_msg *msgs = new bank_msg[ops + R + 2];
+
+   for (int cl = 0; cl < clients; cl++) {
+      //get an ID, retrying while all N are in use
+      bank_msg m;
+      memset(&m, 0, sizeof(m));
+      m.op = BANK_GETID;
+      while (true) {
+	 if (run_client(g, &m, 1) < 0) {
+	    delete[] msgs;
+	    return NULL;
+	 }
+	 if (m.status == BANK_OK) {
+	    break;
+	 }
+	 g->errors--;
+	 g->retries++;
+	 usleep(100);
+      }
+      int my_id = m.i;
+
+      //plan the whole client, so it can be pipelined
+      int want[R], have[R];
+      int n = 0;
+      memset(msgs, 0, (ops + R + 2) * sizeof(bank_msg));
+      for (int r = 0; r < R; r++) {
+	 want[r] = rand_r(&g->seed) % (TOTAL[r] / 4 + 1);
+	 have[r] = 0;
+	 msgs[n].op = BANK_SETMAX;
+	 msgs[n].r = r;
+	 msgs[n].amt = want[r];
+	 n++;
+      }
+      msgs[n].op = BANK_STARTING;
+      n++;
+      for (int k = 0; k < ops; k++) {
+	 int r = rand_r(&g->seed) % R;
+	 if (have[r] < want[r] && (have[r] == 0 || rand_r(&g->seed) % 2 == 0)) {
+	    msgs[n].op = BANK_ALLOC;
+	    msgs[n].amt = 1 + rand_r(&g->seed) % (want[r] - have[r]);
+	    have[r] += msgs[n].amt;
+	 } else if (have[r] > 0) {
+	    msgs[n].op = BANK_RELEASE;
+	    msgs[n].amt = 1 + rand_r(&g->seed) % have[r];
+	    have[r] -= msgs[n].amt;
+	 } else {
+	    continue;
+	 }
+	 msgs[n].r = r;
+	 n++;
+      }
+      msgs[n].op = BANK_FINISHED;
+      n++;
+      for (int k = 0; k < n; k++) {
+	 msgs[k].i = my_id;
+      }
+      if (run_client(g, msgs, n) < 0) {
+	 break;
+      }
+   }
+
+   delete[] msgs;
+   return NULL;
+}
+
+/***********************************************************
+ * int run_client(gen *, bank_msg *, int)
+ * Pre: msgs holds n requests
+ * Post: they were all sent, at most window at a time, and
+ * each is overwritten by its reply. Returns 0, or -1 if the
+ * connection failed
+ *********************************************************/
+int run_client(gen *g, bank_msg *msgs, int n) {
+   double *sent_at = new double[n];
+   bank_msg *out = new bank_msg[window];
+   bank_msg *in = new bank_msg[window];
+   int sent = 0, got = 0, partial = 0;
+   bool ok = true;
+   while (ok && got < n) {
+      int k = 0;
+      while (sent < n && sent - got < window) {
+	 msgs[sent].tag = sent;
+	 out[k] = msgs[sent];
+	 sent_at[sent] = now_us();
+	 sent++;
+	 k++;
+      }
+      if (k > 0 && write(g->fd, out, k * sizeof(bank_msg)) != (ssize_t)(k * sizeof(bank_msg))) {
+	 ok = false;
+	 break;
+      }
+
+      //read whatever replies have arrived, at least one
+      int len = read(g->fd, (char *)in + partial, (sent - got) * sizeof(bank_msg) - partial);
+      if (len <= 0) {
+	 ok = false;
+	 break;
+      }
+      len += partial;
+      int whole = len / sizeof(bank_msg);
+      double t = now_us();
+      for (int j = 0; j < whole; j++) {
+	 msgs[in[j].tag] = in[j];
+	 if (g->nlat < g->cap) {
+	    g->lat[g->nlat] = t - sent_at[in[j].tag];
+	    g->nlat++;
+	 }
+	 g->requests++;
+	 if (in[j].status != BANK_OK) {
+	    g->errors++;
+	 }
+      }
+      got += whole;
+      partial = len - whole * sizeof(bank_msg);
+      memmove(in, (char *)in + whole * sizeof(bank_msg), partial);
+   }
+   if (!ok) {
+      printf("Error: lost the connection to bankerd\n");
+   }
+   delete[] sent_at;
+   delete[] out;
+   delete[] in;
+   return ok ? 0 : -1;
+}
+
+/***********************************************************
+ * double now_us()
+ * Pre: none
+ * Post: a monotonic time in microseconds is returned
+ *********************************************************/
+double now_us() {
+   timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+/***********************************************************
+ * int cmp_double(const void *, const void *)
+ * Pre: a and b point to doubles
+ * Post: they are compared, for qsort()
+ *********************************************************/
+int cmp_double(const void *a, const void *b) {
+   double x = *(const double *)a, y = *(const double *)b;
+   return x < y ? -1 : (x > y ? 1 : 0);
+}
@@ -0,0 +1,140 @@
+/********************************************************
+ * main.cc
+ * Purpose: to run the scenarios against the banker, see
+ * the usage message below
+ *******************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "banker.h"
+#include "scenarios.h"
+#include "sim.h"
+#include "workload.h"
+
+int main(int argc, char **argv) {
+
+   //usage: banker [-s seed] [-n runs] [-t threads] [-p name] [-q] [A|B|C|D|W]
+   //-s runs in simulation mode, with run k seeded by seed+k
+   //-p shares the banker with other processes using the same name
+   //the other options set the parameters of workload W
+   bool simulate = false;
+   unsigned int seed = 0;
+   int runs = 1;
+   int nthreads = N;
+   const char *name = NULL;
+   int opt;
+   while ((opt = getopt(argc, argv, "s:n:t:p:qc:o:d:a:z:m:k:")) != -1) {
+      switch (opt) {
+      case 's':
+	 simulate = true;
+	 seed = strtoul(optarg, NULL, 0);
+	 break;
+      case 'n':
+	 runs = atoi(optarg);
+	 break;
+      case 't':
+	 nthreads = atoi(optarg);
+	 break;
+      case 'p':
+	 name = optarg;
+	 break;
+      case 'q':
+	 verbose = false;
+	 break;
+      case 'c':
+	 wl.clients = atoi(optarg);
+	 break;
+      case 'o':
+	 wl.ops = atoi(optarg);
+	 break;
+      case 'd':
+	 wl.types = atoi(optarg);
+	 break;
+      case 'a':
+	 wl.alloc_pct = atoi(optarg);
+	 break;
+      case 'z':
+	 wl.zipf = atof(optarg);
+	 break;
+      case 'm':
+	 wl.max_pct = atoi(optarg);
+	 break;
+      case 'k':
+	 wl.think_us = atoi(optarg);
+	 break;
+      default:
+	 printf("usage: %s [-s seed] [-n runs] [-t threads] [-p name] [-q] [A|B|C|D|W]\n"
+		"  workload W: [-c clients] [-o ops per client] [-d types per client]\n"
+		"    [-a alloc percent] [-z zipf skew] [-m max percent] [-k think us]\n",
+		argv[0]);
+	 return -1;
+      }
+   }
+
+   if (runs < 1 || nthreads < 1 || nthreads > SIM_MAX || wl.clients < 0 || wl.ops < 0 ||
+       wl.types < 1 || wl.types > R || wl.alloc_pct < 0 || wl.alloc_pct > 100 ||
+       wl.zipf < 0 || wl.max_pct < 0 || wl.max_pct > 100 || wl.think_us < 0) {
+      printf("Error: bad arguments\n");
+      return -1;
+   }
+   if (name != NULL && simulate) {
+      printf("Error: a shared banker can't be simulated\n");
+      return -1;
+   }
+   if (name != NULL) {
+      if (banker_share(name)) {
+	 return -1;
+      }
+   } else if (banker_init()) {
+      return -1;
+   }
+
+   void *(*scenario)(void *) = &scenarioA;
+   if (optind < argc) {
+      switch (argv[optind][0]) {
+      case 'A': scenario = &scenarioA; break;
+      case 'B': scenario = &scenarioB; break;
+      case 'C': scenario = &scenarioC; break;
+      case 'D': scenario = &scenarioD; break;
+      case 'W': scenario = &scenarioW; break;
+      default:
+	 printf("Error: no such scenario %s\n", argv[optind]);
+	 return -1;
+      }
+   }
+
+   long simulated = 0;
+   long ops = 0;
+   timespec start, stop;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   for (int run = 0; run < runs; run++) {
+      if (simulate) {
+	 sim_init(seed + run);
+      }
+      workload_reset();
+      wl.seed = seed + run;
+      for (int i = 0; i < nthreads; i++) {
+	 sim_spawn(scenario, NULL);
+      }
+      sim_join();
+      if (simulate) {
+	 simulated += sim_now();
+      }
+      ops += wl.done_ops;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &stop);
+
+   if (scenario == &scenarioW) {
+      double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+      printf("%d clients made %ld alloc/release calls in %.3f s, %.0f calls/s\n",
+	     wl.clients * runs, ops, secs, secs > 0 ? ops / secs : 0.0);
+   }
+
+   if (simulate) {
+      printf("%d simulated runs took %ld us of virtual time\n", runs, simulated);
+   }
+   printf("All threads have finished... no deadlock!\n");
+}
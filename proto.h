@@ -0,0 +1,63 @@
+// Banker's Algorithm Project
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+
+// This header file defines the protocol spoken over the Unix domain socket
+// between bankerd and its clients.
+//
+// Every request and every reply is one bank_msg, sent as 16 raw bytes in the
+// host's byte order, since both ends are always on the same machine. A client
+// may send many requests without waiting for the replies. Each request gets
+// exactly one reply, carrying the same tag, but not necessarily in the order
+// the requests were sent: the reply to an alloc that has to wait is only sent
+// once the alloc is granted, while later requests for other client IDs go
+// ahead. Requests for the same client ID are always carried out in the order
+// they were sent.
+//
+// A connection first asks for one or more client IDs with BANK_GETID, then uses
+// them just like the functions in banker.h. If the connection is closed, every
+// ID it still holds is finished, releasing whatever it held.
+//
+// When bankerd keeps its tables in a file (bankerd -f), it may be restarted
+// without losing track of what was granted. The IDs that were in use before the
+// restart are held for their clients, who reconnect and claim them again with
+// BANK_ATTACH. A request that was in flight when bankerd died may or may not
+// have been carried out, so its outcome must be treated as unknown. After
+// attaching, the client asks with BANK_QUERY how much of each resource the ID
+// holds, and carries on from there. An ID that nobody attaches to within the
+// grace period (bankerd -g, 60 seconds unless told otherwise) is finished, just
+// as if its client had closed the connection, and BANK_ATTACH for it fails from
+// then on.
+
+struct bank_msg {
+   uint8_t op;     // one of the BANK_ requests below
+   uint8_t status; // in replies, BANK_OK or BANK_ERR
+   uint16_t r;     // resource, for setmax, alloc, release and query
+   int32_t i;      // client ID, or in a reply to BANK_GETID, the new ID
+   int32_t amt;    // amount, for setmax, alloc and release, or in a reply to
+                   // BANK_QUERY, the amount held
+   uint32_t tag;   // chosen by the client, copied into the reply
+};
+
+// Requests
+#define BANK_GETID    1 // get a client ID, fails if all N are in use
+#define BANK_SETMAX   2 // setmax(i, r, amt)
+#define BANK_STARTING 3 // starting(i)
+#define BANK_ALLOC    4 // alloc(i, r, amt), replies when granted
+#define BANK_RELEASE  5 // release(i, r, amt)
+#define BANK_FINISHED 6 // finished(i), the ID may no longer be used
+#define BANK_ATTACH   7 // take back ID i, in use when bankerd restarted, see above
+#define BANK_QUERY    8 // holding(i, r), the amount of r allocated to ID i
+
+// Reply status. BANK_ERR means nothing was done, either because the request
+// used an ID the connection doesn't hold, or because it was one of the errors
+// listed in banker.h.
+#define BANK_OK  0
+#define BANK_ERR 1
+
+// Where bankerd listens unless told otherwise.
+#define BANK_SOCKET "/tmp/bankerd.sock"
+
+#endif // PROTO_H
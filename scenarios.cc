@@ -6,38 +6,34 @@
 #include <unistd.h>
 #include "banker.h"
 #include "scenarios.h"
+#include "sim.h"
 
 // This file implements four scenarios for testing banker's algorithm.
 // See scenarios.h for how to use these scenarios.
+//
+// All sleeping and waiting on condition variables goes through sim_sleep(),
+// sim_cond_wait() and sim_cond_broadcast(), so the scenarios can also be run in
+// the deterministic simulation mode described in sim.h.
 
-// Note: The code here has a nice example of how to use pthread mutexes. Further
-// down below is a second example, using mutexes and condition variables.
+// Note: Further down below is an example of how to use pthread mutexes and
+// condition variables.
 
 // In all of the scenarios below, we need to assign each thread an ID, an
-// integer between 0 and N. We keep a global variable called "next_id" that gets
-// incremented by each thread when it calls the getid() function. But notice, if
-// we aren't careful about synchronization, this would be a race condition! To
-// assign the IDs in a thread-safe manner requires using a mutex, to ensure that
-// no two threads simultanously choose the same ID.
-
-int next_id = 0; // protected by id_lock mutex
-pthread_mutex_t id_lock = PTHREAD_MUTEX_INITIALIZER; // protects next_id variable
-
-// This function returns a fresh, unique number to be used as the ID for the
+// integer between 0 and N. If we aren't careful about synchronization, this
+// would be a race condition: two threads could simultaneously choose the same
+// ID. The IDs are handed out by getslot(), which keeps a bitmap of the IDs in
+// use and claims a free one with an atomic compare-and-swap, so no mutex is
+// needed. When a thread calls finished(), its ID goes back into the bitmap and
+// may be handed to a later thread.
+
+// This function returns a currently unused number to be used as the ID for the
 // calling thread.
 int getid() {
-    pthread_mutex_lock(&id_lock); // start of critical section
-    if (next_id >= N) {
+    int my_id = getslot();
+    if (my_id < 0) {
         printf("error: can't start more than %d threads.\n", N);
-        // note: in error cases like this, we must be careful to unlock the
-        // mutex, otherwise subsequent calls to this function would be
-        // deadlocked.
-        pthread_mutex_unlock(&id_lock); // end critical section early due to error
         pthread_exit(NULL); // quit current thread
     }
-    int my_id = next_id;
-    next_id++;
-    pthread_mutex_unlock(&id_lock); // end of critical section
     return my_id;
 }
 
@@ -73,10 +69,13 @@ int getid() {
 // ordering, but you probably noticed that when you did it on paper.
 
 // These variables are used by scenarioA to coordinate the "barrier" between the
-// phases.
+// phases. The round counter lets the barrier be used again when scenarioA is run
+// many times in a row: the last thread to arrive starts a new round, and the
+// others wait until the round changes.
 int rendezvous_reached = 0; // how many threads have finished phase 1, protected by rendezvous_lock
-pthread_mutex_t rendezvous_lock = PTHREAD_MUTEX_INITIALIZER; // protects rendezvous_reached
-pthread_cond_t rendezvous_cond = PTHREAD_COND_INITIALIZER; // tracks changes to rendezvous_reached
+int rendezvous_round = 0; // how many times the barrier has opened, protected by rendezvous_lock
+pthread_mutex_t rendezvous_lock = PTHREAD_MUTEX_INITIALIZER; // protects rendezvous_reached and rendezvous_round
+pthread_cond_t rendezvous_cond = PTHREAD_COND_INITIALIZER; // tracks changes to rendezvous_round
 
 void *scenarioA(void *ignored) {
     int my_id = getid();
@@ -137,14 +136,19 @@ void *scenarioA(void *ignored) {
     // threads get to here, then the banker's algorithm must have decided that
     // the system is safe.
     pthread_mutex_lock(&rendezvous_lock);
-    printf("Thread %d is waiting for siblings to catch up...\n", my_id);
+    TRACE("Thread %d is waiting for siblings to catch up...\n", my_id);
+    int my_round = rendezvous_round;
     rendezvous_reached++;
-    while (rendezvous_reached != 5) {
-        pthread_cond_wait(&rendezvous_cond, &rendezvous_lock);
+    if (rendezvous_reached == 5) {
+        rendezvous_reached = 0;
+        rendezvous_round++;
+        sim_cond_broadcast(&rendezvous_cond);
+    }
+    while (rendezvous_round == my_round) {
+        sim_cond_wait(&rendezvous_cond, &rendezvous_lock);
     }
-    pthread_cond_broadcast(&rendezvous_cond);
     pthread_mutex_unlock(&rendezvous_lock);
-    printf("Hurray, no deadlock! Thread %d is continuing!\n", my_id);
+    TRACE("Hurray, no deadlock! Thread %d is continuing!\n", my_id);
 
     // Phase 2
     switch (my_id) {
@@ -179,7 +183,7 @@ void *scenarioA(void *ignored) {
             break;
     }
 
-    printf("Thread %d signing off!\n", my_id);
+    TRACE("Thread %d signing off!\n", my_id);
     finished(my_id);
     return NULL;
 }
@@ -202,11 +206,11 @@ void *scenarioB(void *ignored) {
         alloc(my_id, KBD, 1);
         alloc(my_id, MEM, 200);
         alloc(my_id, NET, 20);
-        sleep(1);
+        sim_sleep(1000000);
         release(my_id, NET, 10);
         release(my_id, KBD, 1);
         alloc(my_id, MEM, 300);
-        sleep(1);
+        sim_sleep(1000000);
     } else if (my_id == 1 || my_id == 2) {
         // Threads 1 and 2 want kbd, a little memory, and lots of disk.
         setmax(my_id, KBD, 1);
@@ -218,11 +222,11 @@ void *scenarioB(void *ignored) {
         alloc(my_id, DISK, 20000);
         alloc(my_id, KBD, 1);
         alloc(my_id, MEM, 50);
-        sleep(1);
+        sim_sleep(1000000);
         release(my_id, KBD, 1);
         release(my_id, MEM, 50);
         alloc(my_id, DISK, 15000);
-        sleep(1);
+        sim_sleep(1000000);
     } else if (my_id == 3 || my_id == 4) {
         // Threads 1 and 2 want some memory, some disk, and some network.
         setmax(my_id, MEM, 200);
@@ -233,17 +237,17 @@ void *scenarioB(void *ignored) {
         alloc(my_id, MEM, 100);
         alloc(my_id, DISK, 10000);
         alloc(my_id, NET, 25);
-        sleep(1);
+        sim_sleep(1000000);
         alloc(my_id, DISK, 10000);
         alloc(my_id, MEM, 50);
         release(my_id, NET, 25);
-        sleep(1);
+        sim_sleep(1000000);
         release(my_id, DISK, 20000);
         alloc(my_id, NET, 50);
         release(my_id, MEM, 25);
     }
 
-    printf("Thread %d all done!\n", my_id); 
+    TRACE("Thread %d all done!\n", my_id);
     finished(my_id);
     return NULL;
 }
@@ -306,8 +310,8 @@ void testC(int my_id, int kbd, int disk, int mem, int net) {
         }
 
         // Sleep a little, either 1 second or half a second.
-        if ((rand_r(&seed) % 2) == 0) usleep(1000000);
-        else usleep(500000);
+        if ((rand_r(&seed) % 2) == 0) sim_sleep(1000000);
+        else sim_sleep(500000);
 
         // Release a random amount of each resource.
         if (k > 0) {
@@ -369,7 +373,7 @@ void *scenarioD(void *ignored) {
     for (int r = 0; r < R; r++) {
         have[r] = 0;
         want[r] = rand_r(&seed) % TOTAL[r];
-        printf("Thread %d will want up to %d of %s.\n", my_id, want[r], RNAME[r]);
+        TRACE("Thread %d will want up to %d of %s.\n", my_id, want[r], RNAME[r]);
         setmax(my_id, r, want[r]);
     }
 
@@ -390,7 +394,7 @@ void *scenarioD(void *ignored) {
                 release(my_id, r, amt);
             have[r] -= amt;
         }
-        usleep(rand_r(&seed) % 1000);
+        sim_sleep(rand_r(&seed) % 1000);
     }
 
     finished(my_id);
@@ -0,0 +1,303 @@
+/********************************************************
+ * sim.cc
+ * Purpose: to run the scenarios against a virtual clock
+ * with a deterministic, seeded scheduler. See sim.h
+ *******************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sim.h"
+
+enum sim_state { SIM_RUNNABLE, SIM_SLEEPING, SIM_BLOCKED, SIM_DONE };
+
+struct sim_thread {
+   pthread_t id;
+   void *(*fn)(void *);
+   void *arg;
+   sim_state state;
+   long wake;               // virtual time to wake up, when sleeping
+   pthread_cond_t *waiting; // condition being waited on, when blocked
+   pthread_cond_t turn;     // signaled when this thread may run
+};
+
+bool sim_mode = false;
+
+// Everything below is protected by sim_lock. Only the thread whose index is in
+// sim_running is allowed to run scenario code, all others wait on their turn.
+pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t sim_idle = PTHREAD_COND_INITIALIZER; // signaled when all are done
+sim_thread sim_threads[SIM_MAX];
+int sim_count = 0;
+int sim_running = -1;
+long sim_clock = 0;
+unsigned int sim_seed = 0;
+__thread int sim_self = -1; // index of the calling thread in sim_threads
+
+void *sim_start(void *);
+void sim_exit(void *);
+void sim_handoff();
+int sim_pick();
+
+/***********************************************************
+ * void sim_init(unsigned int)
+ * Pre: no threads are running
+ * Post: simulation mode is on, the scheduler is seeded
+ * and the virtual clock is at zero
+ *********************************************************/
+void sim_init(unsigned int seed) {
+   sim_mode = true;
+   sim_seed = seed;
+   sim_clock = 0;
+}
+
+/***********************************************************
+ * int sim_spawn(void *(*)(void *), void *)
+ * Pre: fewer than SIM_MAX threads were spawned since the
+ * last sim_join()
+ * Post: a thread running fn(arg) is created, but in
+ * simulation mode it waits for its turn. Returns 0, or -1
+ * on error
+ *********************************************************/
+int sim_spawn(void *(*fn)(void *), void *arg) {
+   if (sim_count == SIM_MAX) {
+      printf("Error: can't spawn more than %d threads\n", SIM_MAX);
+      return -1;
+   }
+   sim_thread *t = &sim_threads[sim_count];
+   t->fn = fn;
+   t->arg = arg;
+   t->state = SIM_RUNNABLE;
+   t->wake = 0;
+   t->waiting = NULL;
+   pthread_cond_init(&t->turn, NULL);
+   int err;
+   if (sim_mode) {
+      err = pthread_create(&t->id, NULL, &sim_start, t);
+   } else {
+      err = pthread_create(&t->id, NULL, fn, arg);
+   }
+   if (err) {
+      printf("Error: unable to create thread\n");
+      return -1;
+   }
+   sim_count++;
+   return 0;
+}
+
+/***********************************************************
+ * void sim_join()
+ * Pre: the calling thread is not one of the spawned ones
+ * Post: all spawned threads have run to completion and
+ * been joined
+ *********************************************************/
+void sim_join() {
+   if (sim_mode) {
+      pthread_mutex_lock(&sim_lock);
+      if (sim_count > 0) {
+	 sim_running = sim_pick();
+	 pthread_cond_signal(&sim_threads[sim_running].turn);
+	 while (sim_running != -1) {
+	    pthread_cond_wait(&sim_idle, &sim_lock);
+	 }
+      }
+      pthread_mutex_unlock(&sim_lock);
+   }
+   for (int i = 0; i < sim_count; i++) {
+      pthread_join(sim_threads[i].id, NULL);
+      pthread_cond_destroy(&sim_threads[i].turn);
+   }
+   sim_count = 0;
+}
+
+/***********************************************************
+ * long sim_now()
+ * Pre: none
+ * Post: the virtual time in microseconds is returned
+ *********************************************************/
+long sim_now() {
+   pthread_mutex_lock(&sim_lock);
+   long now = sim_clock;
+   pthread_mutex_unlock(&sim_lock);
+   return now;
+}
+
+/***********************************************************
+ * void sim_sleep(long)
+ * Pre: usec >= 0 and the caller holds no mutex
+ * Post: usec microseconds of virtual (or real) time have
+ * passed
+ *********************************************************/
+void sim_sleep(long usec) {
+   if (!sim_mode) {
+      usleep(usec);
+      return;
+   }
+   pthread_mutex_lock(&sim_lock);
+   sim_threads[sim_self].state = SIM_SLEEPING;
+   sim_threads[sim_self].wake = sim_clock + usec;
+   sim_handoff();
+   pthread_mutex_unlock(&sim_lock);
+}
+
+/***********************************************************
+ * void sim_yield()
+ * Pre: the caller holds no mutex
+ * Post: the scheduler may have let other threads run
+ *********************************************************/
+void sim_yield() {
+   if (!sim_mode) {
+      return;
+   }
+   pthread_mutex_lock(&sim_lock);
+   sim_handoff();
+   pthread_mutex_unlock(&sim_lock);
+}
+
+/***********************************************************
+ * void sim_cond_wait(pthread_cond_t *, pthread_mutex_t *)
+ * Pre: the caller holds m and no other mutex
+ * Post: the caller was woken by a broadcast on c and holds
+ * m again
+ *********************************************************/
+void sim_cond_wait(pthread_cond_t *c, pthread_mutex_t *m) {
+   if (!sim_mode) {
+      pthread_cond_wait(c, m);
+      return;
+   }
+   //no other thread runs until we hand off, so it is safe to
+   //drop m first
+   pthread_mutex_unlock(m);
+   pthread_mutex_lock(&sim_lock);
+   sim_threads[sim_self].state = SIM_BLOCKED;
+   sim_threads[sim_self].waiting = c;
+   sim_handoff();
+   pthread_mutex_unlock(&sim_lock);
+   pthread_mutex_lock(m);
+}
+
+/***********************************************************
+ * void sim_cond_broadcast(pthread_cond_t *)
+ * Pre: none
+ * Post: every thread waiting on c may be scheduled again
+ *********************************************************/
+void sim_cond_broadcast(pthread_cond_t *c) {
+   if (!sim_mode) {
+      pthread_cond_broadcast(c);
+      return;
+   }
+   pthread_mutex_lock(&sim_lock);
+   for (int i = 0; i < sim_count; i++) {
+      if (sim_threads[i].state == SIM_BLOCKED && sim_threads[i].waiting == c) {
+	 sim_threads[i].state = SIM_RUNNABLE;
+	 sim_threads[i].waiting = NULL;
+      }
+   }
+   pthread_mutex_unlock(&sim_lock);
+}
+
+/***********************************************************
+ * void *sim_start(void *)
+ * Pre: t points to this thread's entry in sim_threads
+ * Post: the thread waited for its turn, ran its function
+ * and handed the turn on
+ *********************************************************/
+void *sim_start(void *t) {
+   sim_self = (sim_thread *)t - sim_threads;
+   pthread_mutex_lock(&sim_lock);
+   while (sim_running != sim_self) {
+      pthread_cond_wait(&sim_threads[sim_self].turn, &sim_lock);
+   }
+   pthread_mutex_unlock(&sim_lock);
+   //the cleanup handler also runs if the thread calls pthread_exit()
+   pthread_cleanup_push(&sim_exit, NULL);
+   sim_threads[sim_self].fn(sim_threads[sim_self].arg);
+   pthread_cleanup_pop(1);
+   return NULL;
+}
+
+/***********************************************************
+ * void sim_exit(void *)
+ * Pre: the calling thread is running and about to exit
+ * Post: the thread is marked done and another one runs
+ *********************************************************/
+void sim_exit(void *ignored) {
+   pthread_mutex_lock(&sim_lock);
+   sim_threads[sim_self].state = SIM_DONE;
+   sim_handoff();
+   pthread_mutex_unlock(&sim_lock);
+}
+
+/***********************************************************
+ * void sim_handoff()
+ * Pre: sim_lock is held by the running thread, which has
+ * set its own state
+ * Post: the next thread is picked and given the turn. If
+ * the caller is not done, it waits until its turn comes
+ * back
+ *********************************************************/
+void sim_handoff() {
+   int me = sim_self;
+   int next = sim_pick();
+   if (next < 0) {
+      for (int i = 0; i < sim_count; i++) {
+	 if (sim_threads[i].state != SIM_DONE) {
+	    printf("Error: simulation deadlocked at time %ld us, "
+		   "every thread is waiting\n", sim_clock);
+	    exit(1);
+	 }
+      }
+      sim_running = -1;
+      pthread_cond_signal(&sim_idle);
+      return;
+   }
+   sim_running = next;
+   pthread_cond_signal(&sim_threads[next].turn);
+   if (sim_threads[me].state == SIM_DONE) {
+      return;
+   }
+   while (sim_running != me) {
+      pthread_cond_wait(&sim_threads[me].turn, &sim_lock);
+   }
+}
+
+/***********************************************************
+ * int sim_pick()
+ * Pre: sim_lock is held
+ * Post: a runnable thread is chosen at random and its index
+ * returned, advancing the virtual clock to the next wakeup
+ * if all are asleep. Returns -1 if none can run
+ *********************************************************/
+int sim_pick() {
+   int ready[SIM_MAX];
+   int n = 0;
+   long soonest = -1;
+   for (int i = 0; i < sim_count; i++) {
+      if (sim_threads[i].state == SIM_SLEEPING && sim_threads[i].wake <= sim_clock) {
+	 sim_threads[i].state = SIM_RUNNABLE;
+      }
+      if (sim_threads[i].state == SIM_RUNNABLE) {
+	 ready[n] = i;
+	 n++;
+      } else if (sim_threads[i].state == SIM_SLEEPING) {
+	 if (soonest < 0 || sim_threads[i].wake < soonest) {
+	    soonest = sim_threads[i].wake;
+	 }
+      }
+   }
+   if (n == 0) {
+      if (soonest < 0) {
+	 return -1;
+      }
+      sim_clock = soonest;
+      for (int i = 0; i < sim_count; i++) {
+	 if (sim_threads[i].state == SIM_SLEEPING && sim_threads[i].wake <= sim_clock) {
+	    sim_threads[i].state = SIM_RUNNABLE;
+	    ready[n] = i;
+	    n++;
+	 }
+      }
+   }
+   return ready[rand_r(&sim_seed) % n];
+}
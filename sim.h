@@ -0,0 +1,61 @@
+// Banker's Algorithm Project
+#ifndef SIM_H
+#define SIM_H
+
+#include <pthread.h>
+
+// This header file defines a deterministic simulation mode for running the
+// scenarios against a virtual clock instead of the wall clock.
+//
+// Normally the scenario threads run concurrently and sleep for real, so a run
+// takes seconds and the interleaving depends on the operating system's
+// scheduler. After sim_init() is called, only one scenario thread runs at a
+// time. Whenever the running thread sleeps, waits on a condition variable,
+// reaches a yield point, or exits, the next thread to run is picked using a
+// random number generator seeded by sim_init(). When every thread is asleep,
+// the virtual clock jumps straight to the earliest wakeup time. So the same
+// seed always gives the same interleaving, and sleeps cost no wall time.
+//
+// Threads must be started with sim_spawn() and collected with sim_join(), and
+// must use the sim_ functions below in place of usleep(), pthread_cond_wait()
+// and pthread_cond_broadcast(). Without sim_init(), these simply call the
+// usual functions, so the same code runs in both modes.
+
+// True after sim_init() has been called.
+extern bool sim_mode;
+
+// Maximum number of threads that may be started by sim_spawn() between two
+// calls to sim_join().
+#define SIM_MAX 64
+
+// Turns on simulation mode, seeds the scheduler with _seed_, and sets the
+// virtual clock back to zero. Must not be called while threads are running.
+void sim_init(unsigned int seed);
+
+// Starts a new thread running fn(arg). In simulation mode the thread does not
+// run until sim_join() is called. Returns 0 on success, or -1 on error.
+int sim_spawn(void *(*fn)(void *), void *arg);
+
+// Runs all of the threads started by sim_spawn() and waits for them to finish.
+// In simulation mode, if every remaining thread is blocked on a condition
+// variable, the simulation is deadlocked: an error is printed and the program
+// exits.
+void sim_join();
+
+// Returns the virtual clock, in microseconds since sim_init().
+long sim_now();
+
+// Sleeps for _usec_ microseconds of virtual time, or of real time if
+// simulation mode is off.
+void sim_sleep(long usec);
+
+// A point where, in simulation mode, the scheduler may switch to another
+// thread. The calling thread must not hold any mutex. Does nothing if
+// simulation mode is off.
+void sim_yield();
+
+// Stand-ins for pthread_cond_wait() and pthread_cond_broadcast().
+void sim_cond_wait(pthread_cond_t *c, pthread_mutex_t *m);
+void sim_cond_broadcast(pthread_cond_t *c);
+
+#endif // SIM_H
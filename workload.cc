@@ -0,0 +1,145 @@
+/********************************************************
+ * workload.cc
+ * Purpose: to generate synthetic client workloads for
+ * the banker from a few parameters. See workload.h
+ *******************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include "banker.h"
+#include "sim.h"
+#include "workload.h"
+
+//                   clients ops types alloc zipf max think
+workload wl = {          100, 100,   R,   60, 1.0,  30, 1000, 0, 0, 0 };
+
+int zipf_pick(unsigned int *, const int *, int);
+void run_client(int);
+
+/***********************************************************
+ * void workload_reset()
+ * Pre: no thread is running scenarioW
+ * Post: the counters in wl are zeroed
+ *********************************************************/
+void workload_reset() {
+   wl.next_client = 0;
+   wl.done_ops = 0;
+}
+
+/***********************************************************
+ * void *scenarioW(void *)
+ * Pre: the parameters in wl are set
+ * Post: this worker has played out clients from wl until
+ * there were none left
+ *********************************************************/
+void *scenarioW(void *ignored) {
+   while (true) {
+      int c = __atomic_fetch_add(&wl.next_client, 1, __ATOMIC_RELAXED);
+      if (c >= wl.clients) {
+	 break;
+      }
+      run_client(c);
+   }
+   return NULL;
+}
+
+/***********************************************************
+ * void run_client(int)
+ * Pre: c is the number of a client not yet played out
+ * Post: client c got an ID, made its calls and finished
+ *********************************************************/
+void run_client(int c) {
+   unsigned int seed = wl.seed * 2654435761u + (unsigned)c;
+
+   int my_id = getslot();
+   while (my_id < 0) {
+      //every ID is in use, give the other clients time to finish
+      sim_sleep(100);
+      my_id = getslot();
+   }
+
+   //choose which resources to claim, most popular first
+   int all[R], mine[R], want[R], have[R];
+   int n = 0;
+   for (int r = 0; r < R; r++) {
+      all[r] = r;
+   }
+   //each pick is taken out of the running, so this ends even when
+   //the skew leaves some resource almost no chance of being drawn
+   int left = R;
+   while (n < wl.types) {
+      int r = zipf_pick(&seed, all, left);
+      mine[n] = r;
+      n++;
+      for (int k = 0; k < left; k++) {
+	 if (all[k] == r) {
+	    all[k] = all[left - 1];
+	    left--;
+	    break;
+	 }
+      }
+   }
+
+   for (int r = 0; r < R; r++) {
+      want[r] = 0;
+      have[r] = 0;
+   }
+   for (int k = 0; k < n; k++) {
+      int r = mine[k];
+      int top = (int)((long)TOTAL[r] * wl.max_pct / 100);
+      want[r] = rand_r(&seed) % (top + 1);
+      if (setmax(my_id, r, want[r])) {
+	 want[r] = 0; //no claim to be had, do without this resource
+      }
+   }
+
+   starting(my_id);
+
+   int ops = 0;
+   for (int count = 0; count < wl.ops; count++) {
+      int r = zipf_pick(&seed, mine, n);
+      bool grow = (rand_r(&seed) % 100) < wl.alloc_pct;
+      if (have[r] < want[r] && (grow || have[r] == 0)) {
+	 int amt = 1 + rand_r(&seed) % (want[r] - have[r]);
+	 alloc(my_id, r, amt);
+	 have[r] += amt;
+	 ops++;
+      } else if (have[r] > 0) {
+	 int amt = 1 + rand_r(&seed) % have[r];
+	 release(my_id, r, amt);
+	 have[r] -= amt;
+	 ops++;
+      }
+      if (wl.think_us > 0) {
+	 sim_sleep(rand_r(&seed) % (2 * wl.think_us + 1));
+      }
+   }
+
+   finished(my_id);
+   __atomic_fetch_add(&wl.done_ops, ops, __ATOMIC_RELAXED);
+}
+
+/***********************************************************
+ * int zipf_pick(unsigned int *, const int *, int)
+ * Pre: list holds n > 0 resource numbers
+ * Post: one of them is returned, where resource r is 
+ * chosen with weight 1/(r+1)^zipf
+ *********************************************************/
+int zipf_pick(unsigned int *seed, const int *list, int n) {
+   double weight[R];
+   double sum = 0;
+   for (int k = 0; k < n; k++) {
+      weight[k] = 1.0 / pow(list[k] + 1, wl.zipf);
+      sum += weight[k];
+   }
+   double u = sum * rand_r(seed) / ((double)RAND_MAX + 1);
+   for (int k = 0; k < n - 1; k++) {
+      if (u < weight[k]) {
+	 return list[k];
+      }
+      u -= weight[k];
+   }
+   return list[n - 1];
+}
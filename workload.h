@@ -0,0 +1,52 @@
+// Banker's Algorithm Project
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+// This header file defines a synthetic workload generator for testing banker's
+// algorithm, for when the four fixed scenarios in scenarios.h aren't enough.
+//
+// The workload is described by the parameters in _wl_ below. Like the other
+// scenarios, scenarioW is started on up to N threads. Each thread acts as a
+// worker: it repeatedly takes the next client from the workload, gets an ID for
+// it, plays out that client's whole lifetime (setmax, starting, a series of
+// alloc and release calls, finished), and moves on to the next client, until
+// the workload's clients are all done. So the number of clients may be far
+// larger than N.
+//
+// Each client declares a max for a few resource types, chosen with a Zipf
+// distribution over the resources, so that resource 0 is the most popular,
+// resource 1 the next, and so on. Each max is drawn uniformly between 0 and a
+// percentage of the TOTAL[] of that resource. Each operation picks one of the
+// client's resources, again Zipf-skewed, and either allocates or releases a
+// random amount of it, then thinks for a random time averaging think_us. A turn
+// makes no call if the client has nothing of that resource to release and
+// nothing more it may allocate, so ops is an upper bound on the calls made.
+//
+// The parameters are not checked here; main() rejects values out of range.
+//
+// All randomness comes from rand_r() seeded from _seed_ and the client number,
+// so in simulation mode (see sim.h) a workload replays exactly.
+
+struct workload {
+   int clients;       // client lifetimes to play out, across all workers
+   int ops;           // turns each client takes at an alloc() or release() call
+   int types;         // resource types each client declares a max for, 1 to R
+   int alloc_pct;     // chance, in percent, that an op is an alloc()
+   double zipf;       // skew of the resource choice, 0 means uniform
+   int max_pct;       // largest max claim, in percent of TOTAL[r], 0 to 100
+   int think_us;      // mean think time between ops, in microseconds
+   unsigned int seed; // base seed for the random number generators
+
+   // These are filled in while the workload runs.
+   int next_client;   // number of clients handed out to workers so far
+   long done_ops;     // number of alloc() and release() calls made so far
+};
+
+extern workload wl;
+
+// Gets _wl_ ready to be run again, with the same parameters.
+void workload_reset();
+
+void *scenarioW(void *ignored); // Synthetic workload described by wl.
+
+#endif // WORKLOAD_H